@@ -0,0 +1,229 @@
+// Streaming correlation of events split across segment boundaries
+// Used by Correlator.C and Pipeline.C
+//
+// Every event is read once. Events near a boundary wait in a time-ordered window for their
+// segment until a partner turns up in the neighbouring segment, or until that segment has
+// moved more than time_window past them. Finished events (merged with seg=-1, unmatched or
+// away from a boundary) are written in time order. Events must arrive time-ordered within
+// each segment, as built by Sorter.C, so the work per event and the memory are constant.
+//
+// The event type needs the xpos, ypos, ToTx, ToTy, multx, multy, time, seg and dtime
+// members of the sorted data tree
+
+#ifndef BOUNDARYCORRELATOR_H
+#define BOUNDARYCORRELATOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+
+template <class EventT>
+class BoundaryCorrelator{
+
+public:
+
+  // ------------------------ //
+  // ------- Settings ------- //
+  // ------------------------ //
+
+  int time_window = 30;         // Time window correlated events must lie within
+  float x_window = 3.0;         // x window either side of each boundary
+  float y_window = 3.0;         // Boundary events must have matching y position within the y_window
+  int num_seg = 2;              // Number of segments side by side in x (at most max_seg)
+  float seg_width = 128;        // Channels per segment - boundaries at seg_width*n - 0.5
+
+  // A segment which falls this far (in clocks) behind the most recent one is treated as
+  // having stopped, so it does not hold up the others
+  int64_t max_lag = 1000000;
+
+  // Upper limit on the number of events held back for time ordering
+  size_t max_buffered = 100000;
+
+  // Called for every finished event, together with the time difference of merged events
+  std::function<void(const EventT&, int)> write;
+
+  // Counters for the summary
+  uint64_t num_read = 0;
+  uint64_t num_written = 0;
+  uint64_t num_merged = 0;
+  uint64_t num_forced = 0;      // Written early because max_buffered was reached
+
+  static const int max_seg = 9;
+
+
+  // ------------------------- //
+  // ------- Interface ------- //
+  // ------------------------- //
+
+  BoundaryCorrelator(){
+    for (int i = 0; i < max_seg; i++){
+      segtime[i] = 0;
+      active[i] = false;
+    }
+  }
+
+  // Pass the next event of a segment
+  void Add(const EventT &evt){
+
+    // Skip if the multiplicity in either x or y is zero
+    if (evt.multx == 0 || evt.multy == 0) return;
+    if (evt.seg < 0 || evt.seg >= max_seg) return;
+    num_read++;
+
+    int seg = evt.seg;
+    if (num_read == 1) firsttime = evt.time;
+    active[seg] = true;
+    if (int64_t(evt.time) > segtime[seg]) segtime[seg] = evt.time;
+    if (int64_t(evt.time) > lasttime) lasttime = evt.time;
+
+    int bound = Boundary(evt);
+    if (bound < 0){
+      Output(evt, 0);
+      Release(false);
+      return;
+    }
+
+    // Look for the earliest waiting event on the other side of the same boundary
+    int other = (seg == bound) ? bound + 1 : bound;
+    std::deque<EventT> &window = pending[other];
+    for (typename std::deque<EventT>::iterator it = window.begin(); it != window.end(); ++it){
+      int64_t dt = int64_t(evt.time) - int64_t(it->time);
+      if (dt >= time_window) continue;
+      if (dt <= -time_window) break;      // The rest of the window is later still
+      if (std::abs(evt.ypos - it->ypos) > y_window) continue;
+      if (Boundary(*it) != bound) continue;
+      Merge(*it, evt);
+      window.erase(it);
+      Release(false);
+      return;
+    }
+
+    // No partner yet - wait for the other segment to catch up
+    pending[seg].push_back(evt);
+    Release(false);
+  }
+
+  // Write out everything still held at the end of the data
+  void Flush(){
+    Release(true);
+  }
+
+
+private:
+
+  // Finished event waiting to be written in time order
+  struct Finished{
+    EventT evt;
+    int boundtime;
+    uint64_t order;           // Keeps the arrival order for equal times
+    bool operator<(const Finished &other) const {
+      // priority_queue keeps the largest on top, so invert for the earliest time
+      if (evt.time != other.evt.time) return evt.time > other.evt.time;
+      return order > other.order;
+    }
+  };
+
+  std::deque<EventT> pending[max_seg];      // Boundary events waiting for a partner
+  std::priority_queue<Finished> finished;   // Events waiting to be written
+  int64_t segtime[max_seg];                 // Latest time seen in each segment
+  bool active[max_seg];                     // Segment has delivered at least one event
+  int64_t firsttime = 0;                    // Time of the first event
+  int64_t lasttime = 0;                     // Latest time seen in any segment
+  uint64_t order = 0;
+
+  // Index of the boundary the event lies next to (between segments b and b+1), or -1
+  int Boundary(const EventT &evt) const {
+    int bound = int(std::floor((evt.xpos + 0.5) / seg_width + 0.5)) - 1;
+    if (bound < 0 || bound > num_seg - 2) return -1;
+    if (evt.seg != bound && evt.seg != bound + 1) return -1;
+    if (std::abs(evt.xpos - (seg_width*(bound + 1) - 0.5)) >= x_window) return -1;
+    return bound;
+  }
+
+  // Latest time of a segment, or the start of the data if it has not delivered anything yet
+  int64_t SegTime(int seg) const {
+    return active[seg] ? segtime[seg] : firsttime;
+  }
+
+  // Segment is still delivering data, so later events from it can be expected
+  // Segments which have not started yet are waited for up to max_lag
+  bool Live(int seg) const {
+    if (!active[seg] && seg >= num_seg) return false;
+    return lasttime - SegTime(seg) <= max_lag;
+  }
+
+  void Output(const EventT &evt, int boundtime){
+    Finished f;
+    f.evt = evt;
+    f.boundtime = boundtime;
+    f.order = order++;
+    finished.push(f);
+  }
+
+  // Combine a boundary event with its partner from the other segment
+  // The earlier of the two keeps its time, row number and remaining parameters
+  void Merge(const EventT &a, const EventT &b){
+    EventT first = (b.time < a.time) ? b : a;
+    const EventT &second = (b.time < a.time) ? a : b;
+
+    int ToTx = second.ToTx + first.ToTx;
+    int ToTy = second.ToTy + first.ToTy;
+    float xpos = ((second.ToTx * second.xpos) + (first.ToTx * first.xpos))/float(ToTx);
+    float ypos = ((second.ToTy * second.ypos) + (first.ToTy * first.ypos))/float(ToTy);
+
+    first.ToTx = ToTx;
+    first.ToTy = ToTy;
+    first.xpos = xpos;
+    first.ypos = ypos;
+    first.seg = -1; // Set seg=-1 for reconstructed events
+    first.multx += second.multx;
+    if (second.multy > first.multy) first.multy = second.multy;
+    if (second.dtime > first.dtime) first.dtime = second.dtime;
+
+    Output(first, int(int64_t(second.time) - int64_t(first.time)));
+    num_merged++;
+  }
+
+  // Move waiting boundary events which can no longer find a partner to the output, then
+  // write every event earlier than anything still to come
+  void Release(bool flush){
+
+    // A partner must come from the neighbouring segment within time_window, and each
+    // segment is time ordered, so once the neighbour has passed that window give up
+    for (int seg = 0; seg < max_seg; seg++){
+      while (!pending[seg].empty()){
+        const EventT &evt = pending[seg].front();
+        int bound = Boundary(evt);
+        int other = (seg == bound) ? bound + 1 : bound;
+        bool expired = flush || !Live(other) || SegTime(other) >= int64_t(evt.time) + time_window;
+        if (!expired) break;
+        Output(evt, 0);
+        pending[seg].pop_front();
+      }
+    }
+
+    // Later events from a live segment cannot be earlier than its latest time, and merged
+    // events cannot be earlier than the events still waiting for a partner
+    int64_t limit = INT64_MAX;
+    if (!flush){
+      for (int seg = 0; seg < max_seg; seg++){
+        if (Live(seg) && SegTime(seg) < limit) limit = SegTime(seg);
+        if (!pending[seg].empty() && int64_t(pending[seg].front().time) < limit) limit = pending[seg].front().time;
+      }
+    }
+
+    while (!finished.empty()){
+      bool forced = finished.size() > max_buffered;
+      if (!forced && int64_t(finished.top().evt.time) >= limit && !flush) break;
+      if (forced) num_forced++;
+      write(finished.top().evt, finished.top().boundtime);
+      finished.pop();
+      num_written++;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,266 @@
+// Fast centroid fitting of the ToT distribution of a single event, used by GaussSort.C
+//
+// The channels of an event are collected in a small fixed-size profile (no TGraph) and
+// fitted in closed form, either by three-point Gaussian interpolation around the maximum
+// or by a parabola fit to log(ToT) over all channels (Caruana's method, with the ToT^2
+// weights of Guo). Optionally a batch of closed-form results is refined by a few
+// Gauss-Newton iterations of a full Gaussian least-squares fit, as TGraph::Fit with "gaus".
+// Every fit returns a quality flag, and falls back to the ToT-weighted centroid whenever
+// the Gaussian does not make sense.
+// Channels with zero ToT take no part in the logarithmic fits.
+// A profile holds at most max_profile channels. Channels arriving once it is full are
+// left out of the fit and the result is flagged with fitq_overflow, while the centroid
+// positions of the macros are still calculated from all channels.
+
+#ifndef CENTROIDFIT_H
+#define CENTROIDFIT_H
+
+#include <cmath>
+
+
+// ----------------------------------------- //
+// ----- Fit methods and quality flags ----- //
+// ----------------------------------------- //
+
+const int fit_centroid = 0;      // ToT-weighted centroid only
+const int fit_threepoint = 1;    // Gaussian through the maximum and its two neighbours
+const int fit_caruana = 2;       // Weighted parabola fit to log(ToT) of all channels
+
+const int fitq_ok = 0;           // Gaussian fit succeeded
+const int fitq_single = 1;       // Only one channel - centroid used
+const int fitq_few = 2;          // Fewer than three channels - centroid used
+const int fitq_edge = 3;         // Maximum at the edge of the cluster - centroid used
+const int fitq_flat = 4;         // No peak (curvature not negative) - centroid used
+const int fitq_outside = 5;      // Result outside the cluster - centroid used
+const int fitq_noconverge = 6;   // Refinement failed - closed-form result kept
+const int fitq_centroid = 7;     // Centroid method chosen - no fit done
+
+// Added to any of the above: more channels than max_profile - extra channels ignored
+const int fitq_overflow = 8;
+
+// Most channels held for a single event (see fitq_overflow)
+const int max_profile = 32;
+
+
+// ------------------------------- //
+// ------- Data structures ------- //
+// ------------------------------- //
+
+// ToT against channel for one event, sorted by channel
+struct Profile{
+  int n = 0;
+  bool overflow = false;
+  float pos[max_profile];
+  float amp[max_profile];
+
+  void Clear(){
+    n = 0;
+    overflow = false;
+  }
+
+  // Add a channel, keeping the channels sorted and summing repeated channels
+  // A new channel is dropped, and overflow set, once max_profile channels are held
+  void Add(float p, float a){
+    int i = n;
+    while (i > 0 && pos[i-1] > p) i--;
+    if (i > 0 && pos[i-1] == p){
+      amp[i-1] += a;
+      return;
+    }
+    if (n == max_profile){
+      overflow = true;
+      return;
+    }
+    for (int j = n; j > i; j--){
+      pos[j] = pos[j-1];
+      amp[j] = amp[j-1];
+    }
+    pos[i] = p;
+    amp[i] = a;
+    n++;
+  }
+};
+
+// Result of a fit
+struct FitResult{
+  float mean = 0;
+  float sigma = 0;
+  float height = 0;
+  int quality = fitq_ok;
+};
+
+
+// ----------------------------------- //
+// ------- Closed-form fitting ------- //
+// ----------------------------------- //
+
+// ToT-weighted centroid
+inline FitResult CentroidOf(const Profile &p, int quality){
+  FitResult r;
+  double sum = 0, sumx = 0;
+  int imax = 0;
+  for (int i = 0; i < p.n; i++){
+    sum += p.amp[i];
+    sumx += p.amp[i] * p.pos[i];
+    if (p.amp[i] > p.amp[imax]) imax = i;
+  }
+  r.mean = (sum > 0) ? sumx / sum : p.pos[0];
+  r.height = p.amp[imax];
+  r.quality = quality;
+  return r;
+}
+
+// Gaussian through the maximum and its neighbours, on consecutive channels
+inline FitResult ThreePoint(const Profile &p){
+  int imax = 0;
+  for (int i = 1; i < p.n; i++) if (p.amp[i] > p.amp[imax]) imax = i;
+  if (imax == 0 || imax == p.n - 1) return CentroidOf(p, fitq_edge);
+  if (p.pos[imax] - p.pos[imax-1] != 1 || p.pos[imax+1] - p.pos[imax] != 1) return CentroidOf(p, fitq_edge);
+  // A neighbour with zero ToT leaves the maximum at the edge of the signal
+  if (!(p.amp[imax-1] > 0) || !(p.amp[imax+1] > 0)) return CentroidOf(p, fitq_edge);
+
+  double lm = std::log(p.amp[imax-1]);
+  double l0 = std::log(p.amp[imax]);
+  double lp = std::log(p.amp[imax+1]);
+  double curv = lm - 2*l0 + lp;
+  if (curv >= 0) return CentroidOf(p, fitq_flat);
+
+  FitResult r;
+  r.mean = p.pos[imax] + 0.5 * (lm - lp) / curv;
+  r.sigma = std::sqrt(-1. / curv);
+  r.height = std::exp(l0 - 0.125 * (lp - lm) * (lp - lm) / curv);
+  r.quality = fitq_ok;
+  return r;
+}
+
+// Weighted least-squares parabola through log(ToT), ln y = a + b x + c x^2
+// The weights y^2 undo the distortion of small signals by the logarithm
+inline FitResult Caruana(const Profile &p){
+  int imax = 0;
+  for (int i = 1; i < p.n; i++) if (p.amp[i] > p.amp[imax]) imax = i;
+
+  // Channels relative to the maximum keep the sums well conditioned
+  double x0 = p.pos[imax];
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0, t0 = 0, t1 = 0, t2 = 0;
+  for (int i = 0; i < p.n; i++){
+    if (!(p.amp[i] > 0)) continue;
+    double x = p.pos[i] - x0;
+    double w = double(p.amp[i]) * p.amp[i];
+    double l = std::log(p.amp[i]);
+    double x2 = x*x;
+    s0 += w; s1 += w*x; s2 += w*x2; s3 += w*x2*x; s4 += w*x2*x2;
+    t0 += w*l; t1 += w*x*l; t2 += w*x2*l;
+  }
+
+  // Solve the normal equations by Cramer's rule
+  double det = s0*(s2*s4 - s3*s3) - s1*(s1*s4 - s2*s3) + s2*(s1*s3 - s2*s2);
+  if (std::abs(det) < 1e-12 * s0*s0*s0) return CentroidOf(p, fitq_flat);
+  double a = (t0*(s2*s4 - s3*s3) - s1*(t1*s4 - s3*t2) + s2*(t1*s3 - s2*t2)) / det;
+  double b = (s0*(t1*s4 - s3*t2) - t0*(s1*s4 - s2*s3) + s2*(s1*t2 - t1*s2)) / det;
+  double c = (s0*(s2*t2 - s3*t1) - s1*(s1*t2 - s2*t1) + t0*(s1*s3 - s2*s2)) / det;
+  if (c >= 0) return CentroidOf(p, fitq_flat);
+
+  FitResult r;
+  r.mean = x0 - b / (2*c);
+  r.sigma = std::sqrt(-1. / (2*c));
+  r.height = std::exp(a - b*b / (4*c));
+  r.quality = fitq_ok;
+  return r;
+}
+
+// Fit a single event with the chosen method
+inline FitResult FitProfile(const Profile &p, int method){
+  if (p.n == 0){
+    FitResult r;
+    r.mean = -10;
+    r.quality = fitq_few;
+    return r;
+  }
+  if (p.n == 1) return CentroidOf(p, fitq_single);
+
+  FitResult r;
+  if (method == fit_centroid) r = CentroidOf(p, fitq_centroid);
+  else if (p.n < 3) r = CentroidOf(p, fitq_few);
+  else r = (method == fit_threepoint) ? ThreePoint(p) : Caruana(p);
+
+  // A result which is not a number means there was no peak to fit
+  if (r.quality == fitq_ok && (!std::isfinite(r.mean) || !std::isfinite(r.sigma))){
+    r = CentroidOf(p, fitq_flat);
+  }
+  // A peak outside the channels which fired is not trusted
+  if (r.quality == fitq_ok && (r.mean < p.pos[0] - 1 || r.mean > p.pos[p.n-1] + 1)){
+    r = CentroidOf(p, fitq_outside);
+  }
+  if (p.overflow) r.quality |= fitq_overflow;
+  return r;
+}
+
+
+// ------------------------------------------------ //
+// ------- Batched least-squares refinement ------- //
+// ------------------------------------------------ //
+
+// Refine the successful closed-form fits of n events by Gauss-Newton steps of the full
+// Gaussian model, i.e. an unweighted least-squares fit as done by TGraph::Fit
+// Fits which fail to converge keep their closed-form result with quality fitq_noconverge
+inline void RefineFits(const Profile *profiles, FitResult *results, int n, int iterations=5){
+  for (int e = 0; e < n; e++){
+    const Profile &p = profiles[e];
+    FitResult &r = results[e];
+    if (r.quality != fitq_ok || p.n < 3) continue;
+
+    double A = r.height, mu = r.mean, s = r.sigma;
+    bool failed = false;
+
+    for (int it = 0; it < iterations && !failed; it++){
+
+      // Normal equations of the linearised model, J^T J d = J^T res
+      double jj[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+      double jr[3] = {0,0,0};
+      for (int i = 0; i < p.n; i++){
+        double u = (p.pos[i] - mu) / s;
+        double g = std::exp(-0.5*u*u);
+        double res = p.amp[i] - A*g;
+        double j[3] = {g, A*g*u/s, A*g*u*u/s};
+        for (int k = 0; k < 3; k++){
+          jr[k] += j[k]*res;
+          for (int l = 0; l < 3; l++) jj[k][l] += j[k]*j[l];
+        }
+      }
+
+      double det = jj[0][0]*(jj[1][1]*jj[2][2] - jj[1][2]*jj[2][1])
+                 - jj[0][1]*(jj[1][0]*jj[2][2] - jj[1][2]*jj[2][0])
+                 + jj[0][2]*(jj[1][0]*jj[2][1] - jj[1][1]*jj[2][0]);
+      if (!(std::abs(det) > 1e-30)){
+        failed = true;
+        break;
+      }
+      double dA = (jr[0]*(jj[1][1]*jj[2][2] - jj[1][2]*jj[2][1])
+                 - jj[0][1]*(jr[1]*jj[2][2] - jj[1][2]*jr[2])
+                 + jj[0][2]*(jr[1]*jj[2][1] - jj[1][1]*jr[2])) / det;
+      double dmu = (jj[0][0]*(jr[1]*jj[2][2] - jj[1][2]*jr[2])
+                  - jr[0]*(jj[1][0]*jj[2][2] - jj[1][2]*jj[2][0])
+                  + jj[0][2]*(jj[1][0]*jr[2] - jr[1]*jj[2][0])) / det;
+      double ds = (jj[0][0]*(jj[1][1]*jr[2] - jr[1]*jj[2][1])
+                 - jj[0][1]*(jj[1][0]*jr[2] - jr[1]*jj[2][0])
+                 + jr[0]*(jj[1][0]*jj[2][1] - jj[1][1]*jj[2][0])) / det;
+
+      A += dA;
+      mu += dmu;
+      s += ds;
+
+      // Give up on steps which leave the cluster or make the width meaningless
+      if (!(s > 0.05) || mu < p.pos[0] - 1 || mu > p.pos[p.n-1] + 1) failed = true;
+    }
+
+    if (failed){
+      r.quality = fitq_noconverge;
+      continue;
+    }
+    r.height = A;
+    r.mean = mu;
+    r.sigma = s;
+  }
+}
+
+#endif
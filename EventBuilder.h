@@ -0,0 +1,135 @@
+// Event builder shared by Sorter.C, Pipeline.C and LiveMonitor.C
+//
+// The hits of each segment are summed into one event until a hit arrives more than
+// time_window clocks after the first hit of the event. The event is then finished
+// (ToT-weighted centroids and widths) and passed on, and the new hit starts the next one.
+// Hits must arrive in time order within each segment, as TimeSorter.h makes sure of.
+// Wires have ypos 0, stripes carry a 512 channel offset in ypos.
+
+#ifndef EVENTBUILDER_H
+#define EVENTBUILDER_H
+
+#include <cstdint>
+#include <functional>
+
+
+// Events - entries in the sorted TTree
+struct Event{
+  float xpos=0;                // calculated centroid in x
+  float ypos=0;                // calculated centroid in y
+  int ToTx=0;                  // summed ToT in x
+  int ToTy=0;                  // summed ToT in y
+  int xToTx=0;                 // summed product of ToT and position for wires
+  int yToTy=0;                 // summed product of ToT and position for stripes
+  int multx=0;                 // multiplicity in x
+  int multy=0;                 // multiplicity in y
+  uint64_t time=0;             // time of first entry in event
+  int rawevtnum=0;             // location of first entry in raw data file
+  int minx=1000; int maxx=0;
+  int miny=1000; int maxy=0;
+  int widthx=0; int widthy=0;  // Difference in max and min channels in a single event
+  int seg=0;                   // Segment number
+  long long dtime=0;           // Time since last event
+};
+
+
+class EventBuilder{
+
+public:
+
+  // ------------------------ //
+  // ------- Settings ------- //
+  // ------------------------ //
+
+  int time_window = 30;         // Time window for building events
+  float seg_width = 128;        // Wires per segment - added to xpos for each segment
+
+  // Called for every finished event
+  std::function<void(const Event&)> write;
+
+  static const int max_seg = 9;
+
+  // Event being built in each segment - LiveMonitor.C saves these in its checkpoint
+  Event evtbuff[max_seg];
+
+
+  // ------------------------- //
+  // ------- Interface ------- //
+  // ------------------------- //
+
+  // Add an entry (a hit with xpos, ypos, amp and time) of a segment to its current event
+  // row is the location of the entry in the raw data
+  template <class EntryT>
+  void AddEntry(const EntryT &entry, int row, int seg){
+    if (seg < 0 || seg >= max_seg) return;
+
+    // If the time to the last event is greater than the time window then event is over
+    // The difference is signed so that a late hit joins the current event rather than wrapping
+    if ((long long)(entry.time - evtbuff[seg].time) > time_window){
+
+      EmitEvent(seg);
+
+      // Store the time difference
+      long long dtime = entry.time - evtbuff[seg].time;
+      // overwrite the buffer with an empty event
+      evtbuff[seg] = Event();
+      evtbuff[seg].time = entry.time;
+      evtbuff[seg].rawevtnum = row;
+      evtbuff[seg].seg = seg;
+      evtbuff[seg].dtime = dtime;
+    }
+
+    // Fill if wire
+    if(entry.ypos==0){
+      evtbuff[seg].ToTx += entry.amp;
+      evtbuff[seg].xToTx += (entry.xpos * entry.amp);
+      evtbuff[seg].multx ++;
+      if(entry.xpos>evtbuff[seg].maxx) evtbuff[seg].maxx = entry.xpos;
+      if(entry.xpos<evtbuff[seg].minx) evtbuff[seg].minx = entry.xpos;
+    }
+    // Fill if stripe (and remove 512 channel offset)
+    else{
+      evtbuff[seg].ToTy += entry.amp;
+      evtbuff[seg].yToTy += ((entry.ypos - 512) * entry.amp);
+      evtbuff[seg].multy ++;
+      if(entry.ypos>evtbuff[seg].maxy) evtbuff[seg].maxy = entry.ypos;
+      if(entry.ypos<evtbuff[seg].miny) evtbuff[seg].miny = entry.ypos;
+    }
+  }
+
+  // Finish the event held for a segment and pass it on
+  void EmitEvent(int seg){
+    CalculateEvent(seg);
+    write(evtbuff[seg]);
+  }
+
+  // Finish the events of all segments at the end of the data, including empty ones
+  void Flush(){
+    for (int i = 0; i < max_seg; i++) EmitEvent(i);
+  }
+
+  // Forget the events being built
+  void Clear(){
+    for (int i = 0; i < max_seg; i++) evtbuff[i] = Event();
+  }
+
+
+private:
+
+  // Calculate event parameters
+  void CalculateEvent(int seg){
+    if (evtbuff[seg].multx > 0){
+      evtbuff[seg].xpos = float(evtbuff[seg].xToTx)/evtbuff[seg].ToTx;
+      evtbuff[seg].xpos += (seg*seg_width);
+      evtbuff[seg].widthx = evtbuff[seg].maxx - evtbuff[seg].minx;
+    }
+    else evtbuff[seg].xpos = -10;
+    if (evtbuff[seg].multy > 0){
+      evtbuff[seg].ypos = float(evtbuff[seg].yToTy)/evtbuff[seg].ToTy;
+      evtbuff[seg].widthy = evtbuff[seg].maxy - evtbuff[seg].miny;
+    }
+    else evtbuff[seg].ypos = -10;
+  }
+};
+
+#endif
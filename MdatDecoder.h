@@ -0,0 +1,215 @@
+// Bulk decoder for mdat files, shared by the conversion macros
+// The whole file is memory mapped, buffer headers are validated in place and all
+// events of a buffer are unpacked in one loop into separate columns (struct of arrays)
+
+#ifndef MDATDECODER_H
+#define MDATDECODER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <vector>
+
+
+// -------------------------------------------------------------------//
+// ----------------------- Mdat layout constants ---------------------//
+// -------------------------------------------------------------------//
+
+const size_t mdat_file_header = 58;     // Bytes of file header before the first buffer
+const int    mdat_buffer_header = 21;   // Words of buffer header (also the expected headerlength)
+const size_t mdat_buffer_end = 8;       // Bytes of padding after each buffer
+
+// Return values of DecodeBufferHeader
+const int mdat_ok = 0;          // Valid event buffer
+const int mdat_end = 1;         // Buffer type is not 0x0002 - end of the data
+const int mdat_truncated = 2;   // Buffer runs past the end of the available data
+const int mdat_corrupt = 3;     // Buffer length or header length make no sense
+
+
+// -------------------------------------------------------------------//
+// -------------------------- Data structures ------------------------//
+// -------------------------------------------------------------------//
+
+// Header parameters
+struct Header{
+  uint16_t bufferlength;
+  uint16_t buffertype;
+  uint16_t headerlength;
+  uint16_t buffernumber;
+  uint16_t runID;
+  uint8_t  mcpdID;          // 1 for segment 1, 2 for segment 2
+  uint8_t  status;          //
+  uint64_t headerTS;        // 48 bit timestamp
+  uint64_t param0;          // 48 bit parameter - unused
+  uint64_t param1;          // 48 bit parameter - unused
+  uint64_t param2;          // 48 bit parameter - unused
+  uint64_t param3;          // 48 bit parameter - unused
+};
+
+// Decoded events of one or more buffers, one vector per parameter
+struct HitColumns{
+  std::vector<uint16_t> xpos;     // wire number
+  std::vector<uint16_t> ypos;     // stripe number
+  std::vector<uint16_t> amp;      // ToT in clock cycles (12.5 ns)
+  std::vector<uint64_t> time;     // The full time stamp in clocks (12.5 ns)
+  std::vector<uint8_t>  eventID;  // 0 for real events, 1 for self triggers
+  std::vector<uint32_t> eventTS;  // The 19 bit time stamp within the buffer
+  size_t n = 0;                   // Number of valid entries
+
+  void resize(size_t size){
+    if (xpos.size() >= size) return;
+    xpos.resize(size); ypos.resize(size); amp.resize(size);
+    time.resize(size); eventID.resize(size); eventTS.resize(size);
+  }
+};
+
+// A memory mapped mdat file
+struct MdatFile{
+  const uint8_t *data = 0;
+  size_t size = 0;
+  int fd = -1;
+};
+
+
+// -------------------------------------------------------------------//
+// ------------------------- Mapping the file ------------------------//
+// -------------------------------------------------------------------//
+
+// Map the whole file read-only - returns false if it cannot be opened
+inline bool OpenMdat(const char *filename, MdatFile &file){
+  file.fd = open(filename, O_RDONLY);
+  if (file.fd < 0) return false;
+  struct stat st;
+  if (fstat(file.fd, &st) != 0 || st.st_size == 0){
+    close(file.fd);
+    file.fd = -1;
+    return false;
+  }
+  file.size = st.st_size;
+  void *map = mmap(0, file.size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+  if (map == MAP_FAILED){
+    close(file.fd);
+    file.fd = -1;
+    return false;
+  }
+  // The file is read front to back
+  madvise(map, file.size, MADV_SEQUENTIAL);
+  file.data = (const uint8_t*) map;
+  return true;
+}
+
+inline void CloseMdat(MdatFile &file){
+  if (file.data) munmap((void*) file.data, file.size);
+  if (file.fd >= 0) close(file.fd);
+  file.data = 0;
+  file.size = 0;
+  file.fd = -1;
+}
+
+
+// -------------------------------------------------------------------//
+// ------------------------- Decoding functions ----------------------//
+// -------------------------------------------------------------------//
+
+// Two-byte word, stored high byte first
+inline uint16_t MdatWord(const uint8_t *p){
+  return uint16_t(p[0]) << 8 | p[1];
+}
+
+// Six-byte entry made of three words, lowest word first
+inline uint64_t MdatEntry(const uint8_t *p){
+  return uint64_t(MdatWord(p)) | uint64_t(MdatWord(p+2)) << 16 | uint64_t(MdatWord(p+4)) << 32;
+}
+
+// Number of events in a buffer
+inline int BufferEntries(const Header &header){
+  return (header.bufferlength - mdat_buffer_header) / 3;
+}
+
+// Total size of a buffer in bytes, including the end-of-buffer padding
+inline size_t BufferBytes(const Header &header){
+  return 2*size_t(header.bufferlength) + mdat_buffer_end;
+}
+
+// Decode and check the buffer header at p, with avail bytes left in the file
+inline int DecodeBufferHeader(const uint8_t *p, size_t avail, Header &header){
+  if (avail < 4) return mdat_truncated;
+  header.bufferlength = MdatWord(p);
+  header.buffertype = MdatWord(p+2);
+  if (header.buffertype != 0x0002) return mdat_end;
+  if (avail < 2*mdat_buffer_header) return mdat_truncated;
+  header.headerlength = MdatWord(p+4);
+  header.buffernumber = MdatWord(p+6);
+  header.runID = MdatWord(p+8);
+  header.mcpdID = p[10];
+  header.status = p[11];
+  header.headerTS = MdatEntry(p+12);
+  header.param0 = MdatEntry(p+18);
+  header.param1 = MdatEntry(p+24);
+  header.param2 = MdatEntry(p+30);
+  header.param3 = MdatEntry(p+36);
+  if (header.bufferlength < mdat_buffer_header || header.headerlength != mdat_buffer_header) return mdat_corrupt;
+  if (BufferBytes(header) > avail) return mdat_truncated;
+  return mdat_ok;
+}
+
+// Unpack the events of one buffer into the columns, starting at column index offset
+// p points to the first event, i.e. just after the buffer header
+// The loop has no branches and no dependence between events, so it unrolls and pipelines well
+inline void DecodeHits(const uint8_t *p, int nhits, uint64_t headerTS, HitColumns &cols, size_t offset){
+  uint16_t *__restrict xpos = cols.xpos.data() + offset;
+  uint16_t *__restrict ypos = cols.ypos.data() + offset;
+  uint16_t *__restrict amp = cols.amp.data() + offset;
+  uint64_t *__restrict time = cols.time.data() + offset;
+  uint8_t  *__restrict eventID = cols.eventID.data() + offset;
+  uint32_t *__restrict eventTS = cols.eventTS.data() + offset;
+  for (int i = 0; i < nhits; i++){
+    const uint8_t *q = p + 6*i;
+    // The three words of the event, each stored high byte first
+    uint32_t low = uint32_t(q[0]) << 8 | q[1];
+    uint32_t mid = uint32_t(q[2]) << 8 | q[3];
+    uint32_t high = uint32_t(q[4]) << 8 | q[5];
+    // 48 bit event: eventID 47, amp 46-39, ypos 38-29, xpos 28-19, time 18-0
+    eventID[i] = high >> 15;
+    amp[i] = (high >> 7) & 0xff;
+    ypos[i] = ((high & 0x7f) << 3) | (mid >> 13);
+    xpos[i] = ((mid & 0x1fff) >> 3);
+    eventTS[i] = ((mid & 0x7) << 16) | low;
+    time[i] = headerTS + eventTS[i];
+  }
+}
+
+// Decode the buffer at p (header and events) into the columns starting at offset
+// Returns the DecodeBufferHeader status - the columns are only filled for mdat_ok
+inline int DecodeBuffer(const uint8_t *p, size_t avail, Header &header, HitColumns &cols, size_t offset){
+  int status = DecodeBufferHeader(p, avail, header);
+  if (status != mdat_ok) return status;
+  int nhits = BufferEntries(header);
+  cols.resize(offset + nhits);
+  DecodeHits(p + 2*mdat_buffer_header, nhits, header.headerTS, cols, offset);
+  cols.n = offset + nhits;
+  return mdat_ok;
+}
+
+// Find the start of every buffer from the bufferlength fields, without decoding any events
+// Stores the byte offset of each buffer and returns the status of the first non-valid buffer
+// (mdat_end for a complete file), with the offset where the scan stopped in end
+inline int ScanBuffers(const MdatFile &file, std::vector<size_t> &offsets, size_t &end){
+  Header header;
+  size_t pos = mdat_file_header;
+  int status = mdat_end;
+  while (pos < file.size){
+    status = DecodeBufferHeader(file.data + pos, file.size - pos, header);
+    if (status != mdat_ok) break;
+    offsets.push_back(pos);
+    pos += BufferBytes(header);
+  }
+  if (status == mdat_ok) status = mdat_end;
+  end = pos;
+  return status;
+}
+
+#endif
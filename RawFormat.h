@@ -0,0 +1,283 @@
+// Layouts of the raw data ROOT file written by mdat_conv.C, and a reader for both
+//
+// The original layout is a single rawdata TTree with one entry per hit, carrying the buffer
+// header parameters (mcpdID, status, headerTS, buffernumber, param0-3) on every hit.
+// The compact layout splits this in two:
+//   buffers - one entry per mdat buffer with the header parameters
+//   hits    - one entry per hit with only xpos, ypos, amp, eventID, eventTS and the index
+//             of its entry in buffers
+// The full time stamp is headerTS + eventTS and is put back together when reading.
+//
+// RawReader opens either layout and behaves like the rawdata TTree for SetBranchAddress,
+// GetEntry and GetEntries, so macros read both without caring which one they were given.
+// Only the branches passed to SetBranchAddress are read.
+
+#ifndef RAWFORMAT_H
+#define RAWFORMAT_H
+
+#include "MdatDecoder.h"
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// -------------------------------------------------------------------//
+// ---------------------------- Writing ------------------------------//
+// -------------------------------------------------------------------//
+
+// Output trees of a conversion in either layout, created in the current directory
+// Each thread of a parallel conversion uses its own RawWriter
+class RawWriter{
+
+public:
+
+  TTree *rawdata = 0;       // Original layout
+  TTree *hits = 0;          // Compact layout
+  TTree *buffers = 0;
+
+  RawWriter(bool compact){
+    if (!compact){
+      rawdata = new TTree("rawdata","Raw data converted from mdat to ROOT");
+      rawdata->Branch("xpos", &xpos, "xpos/s");
+      rawdata->Branch("ypos", &ypos, "ypos/s");
+      rawdata->Branch("amp", &amp, "amp/s");
+      rawdata->Branch("time", &time, "time/l");
+      rawdata->Branch("eventID", &eventID, "eventID/b");
+      rawdata->Branch("eventTS", &eventTS, "eventTS/i");
+      rawdata->Branch("mcpdID", &header.mcpdID, "mcpdID/b");
+      rawdata->Branch("status", &header.status, "status/b");
+      rawdata->Branch("param0", &header.param0, "param0/l");
+      rawdata->Branch("param1", &header.param1, "param1/l");
+      rawdata->Branch("param2", &header.param2, "param2/l");
+      rawdata->Branch("param3", &header.param3, "param3/l");
+      rawdata->Branch("headerTS", &header.headerTS, "headerTS/l");
+      rawdata->Branch("buffernumber", &header.buffernumber, "buffernumber/s");
+      return;
+    }
+
+    buffers = new TTree("buffers","Buffer headers converted from mdat to ROOT");
+    buffers->Branch("mcpdID", &header.mcpdID, "mcpdID/b");
+    buffers->Branch("status", &header.status, "status/b");
+    buffers->Branch("runID", &header.runID, "runID/s");
+    buffers->Branch("buffernumber", &header.buffernumber, "buffernumber/s");
+    buffers->Branch("headerTS", &header.headerTS, "headerTS/l");
+    buffers->Branch("param0", &header.param0, "param0/l");
+    buffers->Branch("param1", &header.param1, "param1/l");
+    buffers->Branch("param2", &header.param2, "param2/l");
+    buffers->Branch("param3", &header.param3, "param3/l");
+
+    hits = new TTree("hits","Hits converted from mdat to ROOT");
+    hits->Branch("xpos", &xpos, "xpos/s");
+    hits->Branch("ypos", &ypos, "ypos/s");
+    hits->Branch("amp", &amp8, "amp/b");
+    hits->Branch("eventID", &eventID, "eventID/b");
+    hits->Branch("eventTS", &eventTS, "eventTS/i");
+    hits->Branch("buffer", &buffer, "buffer/i");
+  }
+
+  // Fill the hits first to first+n of the columns, all from the buffer with this header
+  void Fill(const Header &hdr, const HitColumns &cols, size_t first, size_t n){
+    header = hdr;
+    for (size_t i = first; i < first + n; i++){
+      xpos = cols.xpos[i];
+      ypos = cols.ypos[i];
+      amp = cols.amp[i];
+      amp8 = cols.amp[i];
+      time = cols.time[i];
+      eventID = cols.eventID[i];
+      eventTS = cols.eventTS[i];
+      if (rawdata) rawdata->Fill();
+      else hits->Fill();
+    }
+    if (buffers){
+      buffers->Fill();
+      buffer++;
+    }
+  }
+
+  // Fill a number of consecutive buffers decoded into the same columns
+  void Fill(const std::vector<Header> &headers, const HitColumns &cols){
+    size_t i = 0;
+    for (size_t b = 0; b < headers.size(); b++){
+      size_t n = BufferEntries(headers[b]);
+      Fill(headers[b], cols, i, n);
+      i += n;
+    }
+  }
+
+private:
+
+  Header header;
+  uint16_t xpos, ypos, amp;
+  uint8_t amp8;             // ToT is 8 bits in the mdat hit
+  uint64_t time;
+  uint8_t eventID;
+  uint32_t eventTS;
+  uint32_t buffer = 0;      // Entry of the current buffer in the buffers tree
+};
+
+
+// -------------------------------------------------------------------//
+// ---------------------------- Reading ------------------------------//
+// -------------------------------------------------------------------//
+
+class RawReader{
+
+public:
+
+  RawReader(const char *filename){
+    file = TFile::Open(filename);
+    if (!file || file->IsZombie()){
+      std::cout << "Could not open " << filename << std::endl;
+      return;
+    }
+    rawdata = (TTree*) file->Get("rawdata");
+    hits = (TTree*) file->Get("hits");
+    buffers = (TTree*) file->Get("buffers");
+    if (rawdata) rawdata->SetBranchStatus("*", 0);
+    else if (hits && buffers) hits->SetBranchStatus("*", 0);
+    else std::cout << "No raw data in " << filename << std::endl;
+  }
+
+  ~RawReader(){
+    if (file) file->Close();
+    delete file;
+  }
+
+  // The file holds raw data in one of the two layouts
+  bool IsOpen() const { return rawdata || (hits && buffers); }
+  bool IsCompact() const { return !rawdata && hits && buffers; }
+
+  Long64_t GetEntries(){
+    if (rawdata) return rawdata->GetEntries();
+    if (hits) return hits->GetEntries();
+    return 0;
+  }
+
+  void SetCacheSize(Long64_t size){
+    if (rawdata) rawdata->SetCacheSize(size);
+    if (hits) hits->SetCacheSize(size);
+  }
+
+  // Read the named rawdata branch into address from now on, as TTree::SetBranchAddress
+  template <class T>
+  int SetBranchAddress(const char *name, T *address){
+    if (rawdata){
+      rawdata->SetBranchStatus(name, 1);
+      return rawdata->SetBranchAddress(name, address);
+    }
+    if (!IsCompact()) return -1;
+
+    std::string branch = name;
+
+    // Hit parameters come straight from the hits tree
+    if (branch == "xpos") copies.push_back([this, address](){ *address = xpos; });
+    else if (branch == "ypos") copies.push_back([this, address](){ *address = ypos; });
+    else if (branch == "amp") copies.push_back([this, address](){ *address = amp; });
+    else if (branch == "eventID") copies.push_back([this, address](){ *address = eventID; });
+    else if (branch == "eventTS") copies.push_back([this, address](){ *address = eventTS; });
+    // Buffer parameters from the header the hit came in
+    else if (branch == "time") copies.push_back([this, address](){ *address = headers[buffer].headerTS + eventTS; });
+    else if (branch == "mcpdID") copies.push_back([this, address](){ *address = headers[buffer].mcpdID; });
+    else if (branch == "status") copies.push_back([this, address](){ *address = headers[buffer].status; });
+    else if (branch == "headerTS") copies.push_back([this, address](){ *address = headers[buffer].headerTS; });
+    else if (branch == "buffernumber") copies.push_back([this, address](){ *address = headers[buffer].buffernumber; });
+    else if (branch == "param0") copies.push_back([this, address](){ *address = headers[buffer].param0; });
+    else if (branch == "param1") copies.push_back([this, address](){ *address = headers[buffer].param1; });
+    else if (branch == "param2") copies.push_back([this, address](){ *address = headers[buffer].param2; });
+    else if (branch == "param3") copies.push_back([this, address](){ *address = headers[buffer].param3; });
+    else{
+      std::cout << "RawReader: unknown branch " << name << std::endl;
+      return -1;
+    }
+
+    // Hit parameters are read with the hits, buffer parameters are cached from the
+    // buffers tree one column at a time
+    if (branch == "xpos" || branch == "ypos" || branch == "amp" || branch == "eventID" || branch == "eventTS") Enable(branch);
+    else{
+      Enable("buffer");
+      if (branch == "time"){
+        Enable("eventTS");
+        LoadColumn("headerTS", &Header::headerTS);
+      }
+      if (branch == "mcpdID") LoadColumn(name, &Header::mcpdID);
+      if (branch == "status") LoadColumn(name, &Header::status);
+      if (branch == "headerTS") LoadColumn(name, &Header::headerTS);
+      if (branch == "buffernumber") LoadColumn(name, &Header::buffernumber);
+      if (branch == "param0") LoadColumn(name, &Header::param0);
+      if (branch == "param1") LoadColumn(name, &Header::param1);
+      if (branch == "param2") LoadColumn(name, &Header::param2);
+      if (branch == "param3") LoadColumn(name, &Header::param3);
+    }
+    return 0;
+  }
+
+  // Read an entry into the addresses given to SetBranchAddress, as TTree::GetEntry
+  int GetEntry(Long64_t entry){
+    if (rawdata) return rawdata->GetEntry(entry);
+    if (!IsCompact()) return 0;
+    int bytes = hits->GetEntry(entry);
+    if (bytes <= 0) return bytes;
+    if (!headers.empty() && buffer >= headers.size()) return -1;
+    for (size_t i = 0; i < copies.size(); i++) copies[i]();
+    return bytes;
+  }
+
+private:
+
+  TFile *file = 0;
+  TTree *rawdata = 0;
+  TTree *hits = 0;
+  TTree *buffers = 0;
+
+  // Current entry of the hits tree
+  uint16_t xpos = 0, ypos = 0;
+  uint8_t amp = 0;
+  uint8_t eventID = 0;
+  uint32_t eventTS = 0;
+  uint32_t buffer = 0;
+
+  // Buffer headers, holding only the columns which have been asked for
+  std::vector<Header> headers;
+  std::vector<std::string> loaded;
+
+  // Copy the current entry to the addresses of the calling macro
+  std::vector<std::function<void()> > copies;
+
+  // Switch on a branch of the hits tree, reading it into the matching member
+  void Enable(const std::string &branch){
+    const char *name = branch.c_str();
+    hits->SetBranchStatus(name, 1);
+    if (branch == "xpos") hits->SetBranchAddress(name, &xpos);
+    if (branch == "ypos") hits->SetBranchAddress(name, &ypos);
+    if (branch == "amp") hits->SetBranchAddress(name, &amp);
+    if (branch == "eventID") hits->SetBranchAddress(name, &eventID);
+    if (branch == "eventTS") hits->SetBranchAddress(name, &eventTS);
+    if (branch == "buffer") hits->SetBranchAddress(name, &buffer);
+  }
+
+  // Read one column of the buffers tree into the cached headers
+  template <class T>
+  void LoadColumn(const char *name, T Header::*member){
+    for (size_t i = 0; i < loaded.size(); i++) if (loaded[i] == name) return;
+    loaded.push_back(name);
+    T value;
+    buffers->SetBranchStatus("*", 0);
+    buffers->SetBranchStatus(name, 1);
+    buffers->SetBranchAddress(name, &value);
+    Long64_t n = buffers->GetEntries();
+    headers.resize(n);
+    for (Long64_t i = 0; i < n; i++){
+      buffers->GetEntry(i);
+      headers[i].*member = value;
+    }
+    buffers->ResetBranchAddresses();
+  }
+};
+
+#endif
@@ -0,0 +1,165 @@
+// Streaming time sorter for hits or events arriving from several MCPDs (or segments)
+// Used by Sorter.C, Correlator.C, Pipeline.C and SpeedTest.C
+//
+// Each stream is only slightly out of order, so every stream gets a small reorder heap
+// holding the hits of the last max_disorder clocks. A k-way merge across the streams then
+// writes the hits in time order once no stream can still deliver anything earlier.
+// Memory depends on the hit rate and max_disorder, not on the size of the run.
+// Hits more than max_disorder behind their stream arrive too late to be put in place -
+// they are written straight away and counted.
+
+#ifndef TIMESORTER_H
+#define TIMESORTER_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+template <class HitT>
+class TimeSorter{
+
+public:
+
+  // ------------------------ //
+  // ------- Settings ------- //
+  // ------------------------ //
+
+  // How far (in clocks) a hit may arrive behind the latest hit of its stream
+  int64_t max_disorder = 100000;
+
+  // A stream which falls this far behind the latest hit of any stream is treated as
+  // having stopped, so it does not hold up the others
+  int64_t max_lag = 1000000;
+
+  // Upper limit on the number of hits held, in case the disorder is far larger than expected
+  size_t max_held = 4000000;
+
+  // Called for every hit in time order, together with its stream number
+  std::function<void(const HitT&, int)> output;
+
+  // Counters for the summary
+  uint64_t num_read = 0;
+  uint64_t num_written = 0;
+  uint64_t num_reordered = 0;   // Arrived out of order and put back in place
+  uint64_t num_late = 0;        // Arrived after later hits were written - passed on out of order
+  uint64_t num_forced = 0;      // Written early because max_held was reached
+  size_t peak_held = 0;         // Largest number of hits held at once
+
+  static const int max_stream = 16;
+
+
+  // ------------------------- //
+  // ------- Interface ------- //
+  // ------------------------- //
+
+  TimeSorter(){
+    for (int i = 0; i < max_stream; i++){
+      newest[i] = 0;
+      active[i] = false;
+    }
+  }
+
+  // Pass the next hit of a stream
+  void Add(const HitT &hit, uint64_t time, int stream){
+    num_read++;
+
+    if (stream < 0 || stream >= max_stream || int64_t(time) < lastout){
+      num_late++;
+      Write(hit, time, stream);
+      return;
+    }
+
+    if (!active[stream]){
+      active[stream] = true;
+      streams.push_back(stream);
+    }
+    if (int64_t(time) < newest[stream]) num_reordered++;
+    else newest[stream] = time;
+    if (int64_t(time) > latest) latest = time;
+
+    Item item;
+    item.time = time;
+    item.seq = seq++;
+    item.hit = hit;
+    heap[stream].push(item);
+    held++;
+    if (held > peak_held) peak_held = held;
+
+    Release(false);
+  }
+
+  // Write out everything still held at the end of the data
+  void Flush(){
+    Release(true);
+  }
+
+  // Print the counters
+  void Print() const {
+    std::cout << "Time sorter: " << num_read << " read, " << num_reordered << " reordered, ";
+    std::cout << num_late << " late, " << num_forced << " forced, at most " << peak_held << " held" << std::endl;
+  }
+
+
+private:
+
+  struct Item{
+    uint64_t time;
+    uint64_t seq;             // Keeps the arrival order for equal times
+    HitT hit;
+    bool operator>(const Item &other) const {
+      if (time != other.time) return time > other.time;
+      return seq > other.seq;
+    }
+  };
+
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item> > heap[max_stream];
+  int64_t newest[max_stream];       // Latest time seen in each stream
+  bool active[max_stream];          // Stream has delivered at least one hit
+  std::vector<int> streams;         // Active streams
+  int64_t latest = 0;               // Latest time seen in any stream
+  int64_t lastout = -1;             // Time of the last hit written
+  uint64_t seq = 0;
+  size_t held = 0;
+
+  void Write(const HitT &hit, uint64_t time, int stream){
+    output(hit, stream);
+    num_written++;
+    if (int64_t(time) > lastout) lastout = time;
+  }
+
+  // k-way merge of the stream heaps
+  void Release(bool flush){
+
+    // Nothing earlier than this can still arrive from the streams which are delivering data
+    int64_t limit = INT64_MAX;
+    for (size_t i = 0; i < streams.size(); i++){
+      int s = streams[i];
+      if (latest - newest[s] > max_lag) continue;
+      if (newest[s] - max_disorder < limit) limit = newest[s] - max_disorder;
+    }
+
+    while (held > 0){
+
+      // Stream with the earliest waiting hit
+      int first = -1;
+      for (size_t i = 0; i < streams.size(); i++){
+        int s = streams[i];
+        if (heap[s].empty()) continue;
+        if (first < 0 || heap[first].top() > heap[s].top()) first = s;
+      }
+
+      const Item &item = heap[first].top();
+      bool forced = held > max_held;
+      if (!flush && !forced && int64_t(item.time) > limit) break;
+      if (forced) num_forced++;
+
+      Write(item.hit, item.time, first);
+      heap[first].pop();
+      held--;
+    }
+  }
+};
+
+#endif
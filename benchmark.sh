@@ -0,0 +1,133 @@
+#! /bin/bash
+
+# Throughput benchmark of the analysis stages on synthetic mdat files from MdatGenerator.C
+# Prints the wall time, hits/s, events/s (generated events), peak memory and output size of
+# each stage. Times include starting ROOT, the macros are compiled beforehand.
+#
+# usage: ./benchmark.sh [rate] [secs] [check]
+#   rate   generated events per second (default 1e5)
+#   secs   length of the generated run in seconds (default 10)
+#   check  also check the reconstructed positions against the generated ones (BenchCheck.C)
+#          on short low-rate runs, with and without out-of-order hits, check that every MCPD
+#          sends its buffers in buffer number order (LiveMonitor.C), and run FitCheck.C
+
+rate=${1:-1e5}
+secs=${2:-10}
+mode=${3:-}
+
+dir=bench
+mkdir -p $dir
+
+# Compile the macros with ACLiC so that compilation is not timed
+for macro in MdatGenerator mdat_conv Sorter Correlator GaussSort Pipeline BenchCheck LiveMonitor; do
+  root -l -b -q -e '.L '$macro'.C+' > $dir/compile_$macro.log 2>&1 || { echo "Could not compile $macro.C"; exit 1; }
+done
+
+# Generate a run and store the number of events and hits
+generate(){
+  root -l -b -q 'MdatGenerator.C+("'$1'",'$2','$3',2,3,0.02,0.01,'$4')' | tee $dir/generate.log | grep Generated
+  events=$(awk '/^Generated/{print $2}' $dir/generate.log)
+  hits=$(awk '/^Generated/{print $4}' $dir/generate.log)
+}
+
+# Time a stage and print its line of the table
+# The peak memory needs GNU time, without it only the wall time is measured
+# stage name output call
+stage(){
+  if [ -x /usr/bin/time ]; then
+    /usr/bin/time -f "%e %M" -o $dir/time.txt root -l -b -q "$3" > $dir/$1.log 2>&1
+    read wall rss < $dir/time.txt
+  else
+    t1=$(date +%s.%N)
+    root -l -b -q "$3" > $dir/$1.log 2>&1
+    t2=$(date +%s.%N)
+    wall=$(awk -v a=$t1 -v b=$t2 'BEGIN{print b - a}')
+    rss=0
+  fi
+  size=$(stat -c %s $2 2>/dev/null || echo 0)
+  awk -v n="$1" -v w=$wall -v r=$rss -v s=$size -v h=$hits -v e=$events \
+    'BEGIN{ if (w <= 0) w = 0.01; printf "%-16s %8.2f %12.4g %12.4g %10.1f %10.1f\n", n, w, h/w, e/w, r/1024, s/1048576 }'
+}
+
+header(){
+  printf "%-16s %8s %12s %12s %10s %10s\n" "stage" "time/s" "hits/s" "events/s" "RSS/MB" "output/MB"
+}
+
+# Check the positions of a reconstructed file against the truth
+# check name file truth
+check(){
+  root -l -b -q 'BenchCheck.C+("'$2'","'$3'")' > $dir/check_$1.log 2>&1
+  result=$(grep -E "^(PASS|FAIL)" $dir/check_$1.log)
+  printf "%-24s %s\n" "$1" "${result:-FAIL (no result)}"
+  grep -E "found" $dir/check_$1.log | sed 's/^/    /'
+  [ "$result" == "PASS" ] || failed=1
+}
+
+
+# ------------------------------------ //
+# ------- Throughput of each stage --- //
+# ------------------------------------ //
+
+base=$dir/bench
+generate $base.mdat $rate $secs 0.01
+
+# GaussSort.C and Pipeline.C write the same names as Sorter.C and Correlator.C, so they
+# work on links to the input files
+ln -sf $(basename $base).root ${base}_gauss.root
+ln -sf $(basename $base).mdat ${base}_fused.mdat
+
+header
+stage mdat_conv $base.root 'mdat_conv.C+("'$base'.mdat")'
+stage mdat_conv_mt $base.root 'mdat_conv.C+("'$base'.mdat",0,0)'
+stage Sorter ${base}_sorted.root 'Sorter.C+("'$base'.root")'
+stage Correlator ${base}_final.root 'Correlator.C+("'${base}'_sorted.root")'
+stage GaussSort ${base}_gauss_sorted.root 'GaussSort.C+("'${base}'_gauss.root")'
+stage Pipeline ${base}_fused_final.root 'Pipeline.C+("'${base}'_fused.mdat")'
+
+
+# ---------------------------- //
+# ------- Correctness -------- //
+# ---------------------------- //
+
+if [ "$mode" != "check" ]; then
+  exit
+fi
+
+failed=0
+echo
+
+# Fits of CentroidFit.h on hand-made ToT distributions
+root -l -b -q 'FitCheck.C+' > $dir/check_FitCheck.log 2>&1
+result=$(grep -E "^(PASS|FAIL)" $dir/check_FitCheck.log)
+printf "%-24s %s\n" "FitCheck" "${result:-FAIL (no result)}"
+[ "$result" == "PASS" ] || failed=1
+
+# Low rate so that events hardly ever overlap, first in time order then with hits out of order
+for disorder in 0 0.05; do
+  base=$dir/check_$disorder
+  generate $base.mdat 1e4 2 $disorder
+
+  # Every MCPD must number its buffers consecutively, as real MCPDs do
+  root -l -b -q 'LiveMonitor.C+("'$base'.mdat",30,10,1,false)' > $dir/check_buffers_$disorder.log 2>&1
+  if grep -q "End of run reached" $dir/check_buffers_$disorder.log && ! grep -qE "missing|going back" $dir/check_buffers_$disorder.log; then
+    result=PASS
+  else
+    result=FAIL
+    failed=1
+  fi
+  printf "%-24s %s\n" "Buffers_$disorder" "$result"
+
+  ln -sf $(basename $base).root ${base}_gauss.root
+  ln -sf $(basename $base).mdat ${base}_fused.mdat
+  root -l -b -q 'mdat_conv.C+("'$base'.mdat")' > /dev/null 2>&1
+  root -l -b -q 'Sorter.C+("'$base'.root")' > /dev/null 2>&1
+  root -l -b -q 'Correlator.C+("'$base'_sorted.root")' > /dev/null 2>&1
+  root -l -b -q 'Pipeline.C+("'$base'_fused.mdat")' > /dev/null 2>&1
+  root -l -b -q 'GaussSort.C+("'$base'_gauss.root")' > /dev/null 2>&1
+  check Sorter_$disorder ${base}_sorted.root ${base}_truth.root
+  check Correlator_$disorder ${base}_final.root ${base}_truth.root
+  check Pipeline_$disorder ${base}_fused_final.root ${base}_truth.root
+  check GaussSort_$disorder ${base}_gauss_sorted.root ${base}_truth.root
+done
+
+exit $failed
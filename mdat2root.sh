@@ -1,15 +1,35 @@
 #! /bin/bash
 
 # run a succession of scripts on the raw mdat data files
+# pass "fused" as the second argument to do everything in a single pass with Pipeline.C
+# (optional third argument sets the debug taps, see Pipeline.C)
+# pass "compact" to write the raw data in the compact buffers/hits layout (see RawFormat.h)
+# pass "live" to follow a run which is still being written with LiveMonitor.C
 
 filename=$1
+mode=${2:-staged}
+taps=${3:-0}
 basefilename=${filename%.mdat}
 
 mdatfile=$filename
 rootfile=${basefilename}".root"
 sortedfile=${basefilename}"_sorted.root"
 
-root -q -b 'mdat_conv.C("'$mdatfile'")'
+if [ "$mode" == "live" ]; then
+  root -q -b 'LiveMonitor.C+("'$mdatfile'")'
+  exit
+fi
+
+if [ "$mode" == "fused" ]; then
+  root -q -b 'Pipeline.C("'$mdatfile'",'$taps')'
+  exit
+fi
+
+if [ "$mode" == "compact" ]; then
+  root -q -b 'mdat_conv.C("'$mdatfile'",0,1,true,true)'
+else
+  root -q -b 'mdat_conv.C("'$mdatfile'")'
+fi
 
 root -q -b 'Sorter.C("'$rootfile'")'
 